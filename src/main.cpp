@@ -4,7 +4,8 @@
   In this example, instead of acquiring ADC samples as de
   conversion finishes, ATMega328p will wait until timer
   interrup is finished. This program allows the user to acquire
-  samples at 44.100Hz. Some advantages are:
+  samples at F_SPL = 50kHz nominal (see Sampling Rate Definitions,
+  the real rate depends on the board cristal). Some advantages are:
 
   1. No oversampling, causing stress in both LabVIEW and serial port
   2. Increased Stability for serial bus
@@ -15,11 +16,42 @@
 //#include "Arduino.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/eeprom.h>
+#include <string.h>
+#include <math.h>
 
 /* Baudrate Definitions */
+/* U2X0 is set, so BAUD = F_CPU / (8 * (UBRR0 + 1)) */
 #define F_CPU 16000000
-#define BAUD  1000000
-#define BRC   ((F_CPU/16/BAUD) - 1)
+#define BAUD  2000000
+#define BRC   ((F_CPU/8/BAUD) - 1)
+
+/* Sampling Rate Definitions */
+/*
+    Timer 0 in CTC mode fires at
+    F_SPL = F_CPU / (SPL_PRESCALER * (SPL_OCR + 1))
+    Only integer dividers are available, so 44.1kHz and 48kHz
+    can not be produced exactly from a 16MHz cristal.
+*/
+#define SPL_PRESCALER 8
+#define SPL_OCR       39
+#define F_SPL         (F_CPU / (SPL_PRESCALER * (SPL_OCR + 1UL)))
+
+/* Timer 0 clock select bits for SPL_PRESCALER */
+#if   SPL_PRESCALER == 1
+#define SPL_CS ((0 << CS02) | (0 << CS01) | (1 << CS00))
+#elif SPL_PRESCALER == 8
+#define SPL_CS ((0 << CS02) | (1 << CS01) | (0 << CS00))
+#elif SPL_PRESCALER == 64
+#define SPL_CS ((0 << CS02) | (1 << CS01) | (1 << CS00))
+#elif SPL_PRESCALER == 256
+#define SPL_CS ((1 << CS02) | (0 << CS01) | (0 << CS00))
+#elif SPL_PRESCALER == 1024
+#define SPL_CS ((1 << CS02) | (0 << CS01) | (1 << CS00))
+#else
+#error "SPL_PRESCALER must be 1, 8, 64, 256 or 1024"
+#endif
 
 /* Port Output Definitions */
 #define    CLR(port,pin)  (port &= (~(1<<pin)))
@@ -36,11 +68,252 @@
 #define ADC5 0b0101
 #define ADC6 0b0110
 #define ADC7 0b0111
+#define ADC_TEMP     0b1000
+#define ADC_BANDGAP  0b1110
+#define ADC_CHANNEL  ADC0
 
-volatile uint8_t ADC_SPL_COUNT = 0;
+/*
+    Sample counter lives in General Purpose I/O Register 0 so it can
+    be reached with single cycle IN/OUT/SBIS instead of LDS/STS, and
+    without a register reserved for the whole program.
+*/
+#define ADC_SPL_COUNT GPIOR0
 #define ADC_SPL_TH 128
 
-static void USART_Transmit(uint8_t data)               // (p. 184)
+/* Acquisition Options */
+/*
+    ACQ_NAKED_ISR selects the hand written TIMER0_COMPA_vect below,
+    which only saves r24 and SREG. Set it to 0 to use the C version,
+    e.g. for debugging or when adding work to the sample path.
+*/
+#define ACQ_NAKED_ISR 1
+
+/*
+    ACQ_SLEEP selects what the CPU does between samples.
+    ACQ_SLEEP_IDLE : Idle sleep, wakes on the timer ISR. Same sampling
+                     path and rate as before.
+    ACQ_SLEEP_ADC  : ADC Noise Reduction sleep during every conversion,
+                     so the CPU and I/O clocks are stopped while the
+                     sample is taken. Timer 0 and the USART are halted
+                     in that state, hence the conversion is started from
+                     main() after the timer tick, the transmission must
+                     be finished before sleeping and the rate drops to
+                     F_SPL_ADC_SLEEP.
+*/
+#define ACQ_SLEEP_IDLE 0
+#define ACQ_SLEEP_ADC  1
+#define ACQ_SLEEP      ACQ_SLEEP_IDLE
+
+/*
+    In ACQ_SLEEP_ADC Timer 0 stands still for the 13 ADC clocks of each
+    conversion (ADC clock F_CPU / 16, 13us), which adds to the
+    (SPL_OCR_ADC_SLEEP + 1) timer ticks of the period. 53 gives 40us,
+    i.e. 25kHz nominal with SPL_PRESCALER 8.
+*/
+#define SPL_OCR_ADC_SLEEP 53
+#define ADC_CONV_CYCLES   (13 * 16UL)
+#define F_SPL_ADC_SLEEP   (F_CPU / (SPL_PRESCALER * (SPL_OCR_ADC_SLEEP + 1UL) \
+                                    + ADC_CONV_CYCLES))
+
+/*
+    ACQ_REF_MONITOR interleaves side-channel records with the sample
+    blocks. Every REF_PERIOD blocks one slot of REF_BG_SETTLE ticks
+    samples the 1.1V bandgap against AVcc, every REF_TEMP_PERIOD-th
+    slot samples the temperature sensor instead, which needs the 1.1V
+    reference and REF_TEMP_SETTLE ticks for AREF to settle each way.
+    Samples are not taken during a slot: a bandgap slot drops
+    REF_BG_SETTLE + 2 ticks, a temperature slot 2 * REF_TEMP_SETTLE + 1
+    ticks, the record comes right after the block preceding the gap.
+    Off by default, the extra records change the stream seen by
+    AudioSetup.vi. The slot timing assumes the auto triggered ADC, so
+    ACQ_SLEEP_ADC is not supported.
+*/
+#define ACQ_REF_MONITOR   0
+#define REF_PERIOD        64    /* blocks, ~164ms at 50kHz       */
+#define REF_TEMP_PERIOD   64    /* slots,  ~10s                  */
+#define REF_BG_SETTLE     4     /* ticks, bandgap start-up       */
+#define REF_TEMP_SETTLE   500   /* ticks, AREF capacitor ~10ms   */
+
+/* Side-channel record tags */
+#define REC_BANDGAP  'B'
+#define REC_TEMP     'T'
+#define REC_GOERTZEL 'G'
+#define REC_STATS    'S'
+#define REC_KEEPALIVE 'K'
+#define REC_DEADBAND  'D'
+#define REC_DIGITAL   'L'
+
+/*
+    ACQ_CALIBRATION applies the gain and offset stored in EEPROM for
+    ADC_CHANNEL to every sample before it is transmitted:
+    y = (x * gain + 2^14) / 2^15 + offset, clamped to 0..255
+    gain is unsigned Q15 (0x8000 = 1.0, up to ~2.0), offset in LSB.
+*/
+#define ACQ_CALIBRATION   0
+
+/*
+    ACQ_BIQUAD runs BIQ_STAGES direct form I biquads on every sample and
+    keeps one output every BIQ_DECIMATION samples, so the stream rate is
+    F_SPL / BIQ_DECIMATION. Each stage costs five 16x16 multiplies,
+    about 190 cycles by instruction count (not measured on a board),
+    which with the C ISR overhead leaves room for one stage in the 320
+    cycles of a 50kHz tick. More stages need SPL_OCR >= 63 (31.25kHz,
+    512 cycles) for two. Coefficients are
+    Q14 (a0 = 1). They start as a Butterworth low-pass of order
+    2 * BIQ_STAGES at BIQ_CUTOFF, below the decimated Nyquist rate, and
+    can be replaced at run time with the command
+    CMD_BIQUAD on the USART receiver:
+    'Q', stage, b0, b1, b2, a1, a2, sum  (int16 little endian each)
+    sum is the 8-bit sum of the stage and coefficient bytes.
+*/
+#define ACQ_BIQUAD        0
+#define BIQ_STAGES        1
+#define BIQ_DECIMATION    4
+#define BIQ_CUTOFF        5000  /* Hz, < F_SPL / (2 * BIQ_DECIMATION) */
+
+/* Command channel */
+#define CMD_BIQUAD  'Q'
+
+/*
+    ACQ_MODE selects what is transmitted for each ADC_SPL_TH block.
+    ACQ_MODE_RAW      : every sample, then '\n'.
+    ACQ_MODE_GOERTZEL : one REC_GOERTZEL record with the magnitude of
+                        each GTZ_FREQS bin over the block, 4 + 3 *
+                        GTZ_BINS bytes instead of 129 (10 bytes, ~13x
+                        less, with the default 2 bins, ~18x with one).
+    ACQ_MODE_STATS    : one REC_STATS record with min, max, sum and
+                        sum of squares of the block, 13 bytes.
+    ACQ_MODE_DEADBAND : no blocks, one REC_DEADBAND record per sample
+                        that moved more than DB_DEADBAND LSB from the
+                        last one sent, with the ticks since then.
+    Outside ACQ_MODE_RAW the ISR only accumulates and main() formats
+    and transmits the record while the next block is acquired.
+*/
+#define ACQ_MODE_RAW      0
+#define ACQ_MODE_GOERTZEL 1
+#define ACQ_MODE_STATS    2
+#define ACQ_MODE_DEADBAND 3
+#define ACQ_MODE          ACQ_MODE_RAW
+
+/*
+    Goertzel bins in Hz, computed against the nominal F_SPL. Samples
+    are halved to keep the int16 state from overflowing, which limits
+    bins to 0.02 * F_SPL .. 0.48 * F_SPL (checked at compile time). A
+    sine of amplitude A LSB centred on a bin reads as m = A * ADC_SPL_TH
+    / 4. Each bin costs about 55 cycles per sample by instruction count
+    (one __mulhisi3, no shift loops), so 2 bins plus the C ISR overhead
+    stay around 200 of the 320 cycles of a 50kHz tick; 4 bins would
+    not fit. This is an estimate, it was not measured on a board.
+*/
+#define GTZ_FREQS   {1000, 5000}
+
+/*
+    Deadband records are queued in DB_FIFO entries. When the queue is
+    full the change is reported by a later sample instead, and a record
+    is forced every DB_MAX_DT ticks so the host timeline stays anchored.
+*/
+#define DB_DEADBAND 2           /* LSB                            */
+#define DB_MAX_DT   50000       /* ticks, ~1s                     */
+#define DB_FIFO     16          /* entries, power of 2            */
+
+/*
+    ACQ_GATE streams raw blocks only while the signal is active. The
+    variance of each block, so a DC offset does not count, is compared
+    with GATE_ON to open the gate, and the gate closes after
+    GATE_HANGOVER consecutive blocks below GATE_OFF. On opening, the
+    GATE_PREROLL blocks before the trigger are sent first, preceded by
+    a REC_KEEPALIVE record with the number of blocks that were not sent.
+    While closed the same record is sent every GATE_KEEPALIVE blocks.
+    Blocks are buffered in GATE_RING slots of ADC_SPL_TH bytes and sent
+    by main().
+*/
+#define ACQ_GATE          0
+#define GATE_ON           64    /* LSB^2, ~8 LSB RMS around the mean */
+#define GATE_OFF          16    /* LSB^2, ~4 LSB RMS around the mean */
+#define GATE_HANGOVER     20    /* blocks, ~50ms                 */
+#define GATE_PREROLL      2     /* blocks                        */
+#define GATE_RING         4     /* blocks, power of 2, <= 8      */
+#define GATE_KEEPALIVE    390   /* blocks, ~1s                   */
+
+/*
+    ACQ_DIGITAL samples the DIG_BITS digital inputs returned by
+    DIG_READ() on the same timer tick as the conversion.
+    DIG_PACK_LSB : the bits replace the DIG_BITS (up to 2) least
+                   significant bits of every analog sample, at no
+                   link cost but losing those ADC bits. Works with
+                   raw streaming and ACQ_GATE.
+    DIG_PACK_BYTE: a second byte, 0x40 | bits, follows every analog
+                   sample, DIG_BITS up to 6. Blocks grow to 256 bytes
+                   plus '\n', about half of the link at 50kHz. Raw
+                   streaming only.
+    DIG_PACK_RLE : run-length encoded per block into a REC_DIGITAL
+                   record of at most DIG_MAX_RUNS runs, DIG_BITS up to
+                   6. Needs a block mode whose records are sent by
+                   main(), ACQ_MODE_STATS, ACQ_MODE_GOERTZEL or
+                   ACQ_GATE, which sends the record of each block
+                   right after it.
+    PD0/PD1 carry the USART, the default reads PD2.. (Arduino D2..).
+*/
+#define ACQ_DIGITAL       0
+#define DIG_PACK_LSB      0
+#define DIG_PACK_RLE      1
+#define DIG_PACK_BYTE     2
+#define DIG_PACK          DIG_PACK_BYTE
+#define DIG_BITS          2
+#define DIG_MASK          ((1 << DIG_BITS) - 1)
+#define DIG_READ()        ((PIND >> 2) & DIG_MASK)
+#define DIG_MAX_RUNS      16
+
+/* Options that add work to the sample path can not use the naked ISR */
+#define ACQ_SAMPLE_WORK (ACQ_REF_MONITOR || ACQ_CALIBRATION || ACQ_BIQUAD || \
+                         ACQ_MODE != ACQ_MODE_RAW || ACQ_GATE || ACQ_DIGITAL)
+
+/* Options whose records are transmitted by main() */
+#define ACQ_MAIN_OUTPUT (ACQ_MODE != ACQ_MODE_RAW || ACQ_GATE)
+
+#if ACQ_MAIN_OUTPUT && ACQ_SLEEP == ACQ_SLEEP_ADC
+#error "ACQ_SLEEP_ADC transmits every sample from main(), it only supports raw streaming"
+#endif
+#if ACQ_MAIN_OUTPUT && ACQ_REF_MONITOR
+#error "ACQ_REF_MONITOR records are sent from the ISR, they would interleave with main()"
+#endif
+#if ACQ_BIQUAD && BIQ_CUTOFF * 2 * BIQ_DECIMATION >= F_SPL
+#error "BIQ_CUTOFF must be below the Nyquist rate after decimation"
+#endif
+#if ACQ_BIQUAD && BIQ_STAGES > 1 && (SPL_OCR + 1) * SPL_PRESCALER < 256 * BIQ_STAGES
+#warning "BIQ_STAGES may overrun the timer tick, raise SPL_OCR"
+#endif
+#if ACQ_BIQUAD && ACQ_SLEEP == ACQ_SLEEP_ADC
+#error "ACQ_BIQUAD needs the sample path in the timer ISR, and ACQ_SLEEP_ADC stops the command receiver"
+#endif
+#if ACQ_REF_MONITOR && ACQ_SLEEP == ACQ_SLEEP_ADC
+#error "ACQ_REF_MONITOR slots assume the auto triggered ADC pipeline, and send nothing for USART_Flush() to wait on"
+#endif
+#if ACQ_DIGITAL && DIG_PACK == DIG_PACK_LSB && DIG_BITS > 2
+#error "DIG_PACK_LSB replaces at most 2 bits of each sample"
+#endif
+#if ACQ_DIGITAL && DIG_PACK == DIG_PACK_LSB && ACQ_MODE != ACQ_MODE_RAW
+#error "DIG_PACK_LSB is only transmitted with raw blocks, it would corrupt the ACQ_MODE results"
+#endif
+#if ACQ_DIGITAL && DIG_PACK == DIG_PACK_BYTE && \
+    (DIG_BITS > 6 || ACQ_MODE != ACQ_MODE_RAW || ACQ_GATE)
+#error "DIG_PACK_BYTE needs DIG_BITS <= 6 and raw streaming without ACQ_GATE"
+#endif
+#if ACQ_DIGITAL && DIG_PACK == DIG_PACK_RLE && (DIG_BITS > 6 || \
+    (ACQ_MODE != ACQ_MODE_STATS && ACQ_MODE != ACQ_MODE_GOERTZEL && ! ACQ_GATE))
+#error "DIG_PACK_RLE needs DIG_BITS <= 6 and ACQ_MODE_STATS, ACQ_MODE_GOERTZEL or ACQ_GATE"
+#endif
+#if ACQ_GATE && ACQ_MODE != ACQ_MODE_RAW
+#error "ACQ_GATE gates raw sample blocks, use ACQ_MODE_RAW"
+#endif
+#if ACQ_GATE && (GATE_RING & (GATE_RING - 1) || GATE_RING > 8 || GATE_RING < GATE_PREROLL + 2)
+#error "GATE_RING must be a power of 2, at most 8 and hold GATE_PREROLL + 2 blocks"
+#endif
+
+/* ADMUX while sampling ADC_CHANNEL: AVcc reference, left aligned */
+#define ADMUX_SAMPLE ((1 << REFS0) | (1 << ADLAR) | (ADC_CHANNEL & MUXMASK))
+
+static inline void USART_Transmit(uint8_t data)        // (p. 184)
 {
   /* Wait until TX data frame is empty */
   while ( ! ( UCSR0A & (1 << UDRE0)))           // (p. 195)
@@ -50,7 +323,967 @@ static void USART_Transmit(uint8_t data)               // (p. 184)
   UDR0 = data;                                  // (p. 195)
 }
 
+static inline void USART_Flush(void)
+{
+  /* Wait until TX data frame is empty */
+  while ( ! ( UCSR0A & (1 << UDRE0)))           // (p. 195)
+  {;}
+  /* Wait until the shift register is empty */
+  while ( ! ( UCSR0A & (1 << TXC0)))            // (p. 195)
+  {;}
+  /* Clear TX complete flag by writing one */
+  UCSR0A = (1 << TXC0) | (1 << U2X0);
+}
+
+#if ACQ_REF_MONITOR || ACQ_MAIN_OUTPUT
+/*
+    Record values are sent MSB first in groups of 6 bits with 0x40
+    set, so no payload byte can be the '\n' termination char.
+*/
+static void REC_Value(uint32_t value, uint8_t groups)
+{
+  while (groups--)
+    USART_Transmit(0x40 | ((value >> (6 * groups)) & 0x3F));
+}
+#endif
+
+#if ACQ_REF_MONITOR
+static uint8_t  REF_BLOCKS = 0;   /* Blocks since the last slot   */
+static uint8_t  REF_SLOTS  = 0;   /* Slots since the last T record */
+static uint16_t REF_TICKS  = 0;   /* Ticks left in the slot, 0 = sampling */
+static uint16_t REF_OUT    = 0;   /* Ticks kept after the record  */
+static uint8_t  REF_TAG    = 0;
+
+/* Side-channel record: tag, 10-bit value, termination char */
+static void REF_Record(uint8_t tag)
+{
+  uint16_t value;
+
+  /* ADCL first, it locks ADCH until read */
+  value  = ADCL >> 6;
+  value |= (uint16_t)ADCH << 2;
+  USART_Transmit(tag);
+  REC_Value(value, 2);
+  USART_Transmit('\n');
+}
+
+/* Called at the end of each block, opens a slot every REF_PERIOD */
+static inline void REF_Block(void)
+{
+  if (++REF_BLOCKS < REF_PERIOD)
+    return;
+  REF_BLOCKS = 0;
+
+  /*
+      Conversions are pipelined one tick behind the ISR, so the
+      slot is one tick longer than the settling time, and one more
+      tick is dropped after restoring ADMUX.
+  */
+  if (++REF_SLOTS >= REF_TEMP_PERIOD)
+  {
+    REF_SLOTS = 0;
+    REF_TAG   = REC_TEMP;
+    REF_OUT   = REF_TEMP_SETTLE;
+    ADMUX     = (1 << REFS1) | (1 << REFS0) | (1 << ADLAR) | ADC_TEMP;
+    REF_TICKS = REF_TEMP_SETTLE + 1 + REF_OUT;
+  }
+  else
+  {
+    REF_TAG   = REC_BANDGAP;
+    REF_OUT   = 1;
+    ADMUX     = (1 << REFS0) | (1 << ADLAR) | ADC_BANDGAP;
+    REF_TICKS = REF_BG_SETTLE + 1 + REF_OUT;
+  }
+}
+
+/* Returns non zero while the tick belongs to a slot */
+static inline uint8_t REF_Slot(void)
+{
+  if ( ! REF_TICKS)
+    return 0;
+
+  if (--REF_TICKS == REF_OUT)
+  {
+    REF_Record(REF_TAG);
+    ADMUX = ADMUX_SAMPLE;
+  }
+  return 1;
+}
+#endif
+
+#if ACQ_CALIBRATION
+typedef struct
+{
+  uint16_t gain;                  /* Q15, 0x8000 = 1.0 */
+  int8_t   offset;                /* LSB              */
+} CAL_Coef;
+
+/* One entry per ADC pin, written by the calibration procedure */
+CAL_Coef CAL_EEPROM[8] EEMEM =
+{
+  {0x8000, 0}, {0x8000, 0}, {0x8000, 0}, {0x8000, 0},
+  {0x8000, 0}, {0x8000, 0}, {0x8000, 0}, {0x8000, 0},
+};
+
+static CAL_Coef CAL;
+
+/* Load ADC_CHANNEL coefficients, erased EEPROM means no correction */
+static void CAL_Load(void)
+{
+  eeprom_read_block(&CAL, &CAL_EEPROM[ADC_CHANNEL & MUXMASK], sizeof(CAL));
+  if (CAL.gain == 0xFFFF)
+  {
+    CAL.gain   = 0x8000;
+    CAL.offset = 0;
+  }
+}
+
+static inline uint8_t CAL_Apply(uint8_t sample)
+{
+  int16_t value;
+
+  /* 8x16 bit product fits 24 bits, keep the upper part with rounding */
+  value  = (int16_t)(((uint32_t)sample * CAL.gain + 0x4000) >> 15);
+  value += CAL.offset;
+  if (value < 0)
+    return 0;
+  if (value > 255)
+    return 255;
+  return (uint8_t)value;
+}
+#endif
+
+#if ACQ_BIQUAD
+typedef struct
+{
+  int16_t b0, b1, b2, a1, a2;     /* Q14 */
+} BIQ_Coef;
+
+typedef struct
+{
+  int16_t x1, x2, y1, y2;
+} BIQ_State;
+
+static BIQ_Coef  BIQ_COEF[BIQ_STAGES];
+static BIQ_State BIQ_STATE[BIQ_STAGES];
+static uint8_t   BIQ_COUNT = 0;
+
+static inline int16_t BIQ_Q14(double value)
+{
+  return (int16_t)lround(value * (1 << 14));
+}
+
+/* Default anti-aliasing low-pass until coefficients are uploaded */
+static void BIQ_Init(void)
+{
+  double  w0 = 2.0 * M_PI * BIQ_CUTOFF / F_SPL;
+  double  cw = cos(w0);
+  double  q, alpha, a0;
+  uint8_t i;
+
+  for (i = 0; i < BIQ_STAGES; i++)
+  {
+    /* Butterworth pole pair i, RBJ low-pass section */
+    q     = 1.0 / (2.0 * cos((2 * i + 1) * M_PI / (4.0 * BIQ_STAGES)));
+    alpha = sin(w0) / (2.0 * q);
+    a0    = 1.0 + alpha;
+    BIQ_COEF[i].b0 = BIQ_Q14((1.0 - cw) / 2.0 / a0);
+    BIQ_COEF[i].b1 = BIQ_Q14((1.0 - cw) / a0);
+    BIQ_COEF[i].b2 = BIQ_COEF[i].b0;
+    BIQ_COEF[i].a1 = BIQ_Q14(-2.0 * cw / a0);
+    BIQ_COEF[i].a2 = BIQ_Q14((1.0 - alpha) / a0);
+  }
+}
+
+static inline int16_t BIQ_Stage(const BIQ_Coef *c, BIQ_State *st, int16_t x)
+{
+  int32_t acc;
+  int16_t y;
+
+  acc  = (int32_t)c->b0 * x;
+  acc += (int32_t)c->b1 * st->x1;
+  acc += (int32_t)c->b2 * st->x2;
+  acc -= (int32_t)c->a1 * st->y1;
+  acc -= (int32_t)c->a2 * st->y2;
+  /*
+      Back to Q0: the high word is a register move where acc >> 14 is a
+      14 step loop of 32-bit shifts. The two bits lost are 1/16 LSB of
+      the 8-bit sample with the 6 bits of headroom. Saturate so the
+      state never wraps around.
+  */
+  y = (int16_t)(acc >> 16);
+  if (y >  8191)
+    y =  8191;
+  if (y < -8192)
+    y = -8192;
+  y <<= 2;
+
+  st->x2 = st->x1;
+  st->x1 = x;
+  st->y2 = st->y1;
+  st->y1 = y;
+  return y;
+}
+
+/* Filter one sample, returns non zero when it is kept by decimation */
+static inline uint8_t BIQ_Decimate(uint8_t *sample)
+{
+  int16_t value;
+  uint8_t i;
+
+  /* Centre around zero with 6 bits of headroom for the state */
+  value = ((int16_t)*sample - 128) << 6;
+  for (i = 0; i < BIQ_STAGES; i++)
+    value = BIQ_Stage(&BIQ_COEF[i], &BIQ_STATE[i], value);
+
+  if (++BIQ_COUNT < BIQ_DECIMATION)
+    return 0;
+  BIQ_COUNT = 0;
+
+  value = (value >> 6) + 128;
+  if (value < 0)
+    value = 0;
+  if (value > 255)
+    value = 255;
+  *sample = (uint8_t)value;
+  return 1;
+}
+
+/* Command channel state: stage, coefficients, checksum */
+static uint8_t CMD_BUF[1 + sizeof(BIQ_Coef) + 1];
+static uint8_t CMD_LEN = 0;
+
+/* USART Receive Complete Interrupt, collects CMD_BIQUAD frames */
+ISR(USART_RX_vect)
+{
+  /* Error flags belong to the byte in UDR0, read them first */
+  uint8_t status = UCSR0A;                              // (p. 195)
+  uint8_t data   = UDR0;                                // (p. 195)
+  uint8_t stage, sum, i;
+
+  /*
+      A lost or broken byte would shift the rest of the frame, drop it
+      and wait for the next command byte.
+  */
+  if (status & ((1 << DOR0) | (1 << FE0)))
+  {
+    CMD_LEN = 0;
+    return;
+  }
+
+  if (CMD_LEN == 0)
+  {
+    /* Wait for the command byte, anything else is ignored */
+    if (data == CMD_BIQUAD)
+      CMD_LEN = 1;
+    return;
+  }
+
+  CMD_BUF[CMD_LEN - 1] = data;
+  if (++CMD_LEN <= sizeof(CMD_BUF))
+    return;
+  CMD_LEN = 0;
+
+  /* Drop frames whose checksum does not match */
+  sum = 0;
+  for (i = 0; i < sizeof(CMD_BUF) - 1; i++)
+    sum += CMD_BUF[i];
+  if (sum != CMD_BUF[sizeof(CMD_BUF) - 1])
+    return;
+
+  /*
+      Interrupts do not nest and ACQ_SLEEP_ADC is rejected, so the
+      filter, which always runs in the timer ISR, sees either set.
+  */
+  stage = CMD_BUF[0];
+  if (stage >= BIQ_STAGES)
+    return;
+  /* avr-gcc is little endian, same as the frame */
+  memcpy(&BIQ_COEF[stage], &CMD_BUF[1], sizeof(BIQ_Coef));
+  memset(&BIQ_STATE[stage], 0, sizeof(BIQ_State));
+}
+#endif
+
+#if ACQ_DIGITAL
+/* Digital inputs belonging to the sample ACQ_Sample() processes next */
+static uint8_t DIG_VALUE = 0;
+#if ACQ_SLEEP != ACQ_SLEEP_ADC
+static uint8_t DIG_NEXT  = 0;
+#endif
+
+/* Called on every timer tick, as close to the ADC trigger as possible */
+static inline void DIG_Tick(void)
+{
+#if ACQ_SLEEP == ACQ_SLEEP_ADC
+  /* main() converts right after the tick */
+  DIG_VALUE = DIG_READ();
+#else
+  /* The ISR reads the conversion started on the previous tick */
+  DIG_VALUE = DIG_NEXT;
+  DIG_NEXT  = DIG_READ();
+#endif
+}
+
+#if DIG_PACK == DIG_PACK_RLE
+typedef struct
+{
+  uint8_t state;
+  uint8_t length;
+} DIG_Run;
+
+typedef struct
+{
+  DIG_Run run[DIG_MAX_RUNS];
+  uint8_t count;
+  uint8_t overflow;               /* More changes than DIG_MAX_RUNS */
+} DIG_Block_Runs;
+
+static DIG_Block_Runs DIG;
+
+static inline void DIG_Sample(uint8_t value)
+{
+  if (DIG.count && DIG.run[DIG.count - 1].state == value)
+  {
+    DIG.run[DIG.count - 1].length++;
+  }
+  else if (DIG.count < DIG_MAX_RUNS)
+  {
+    DIG.run[DIG.count].state  = value;
+    DIG.run[DIG.count].length = 1;
+    DIG.count++;
+  }
+  else
+  {
+    /* Out of runs, the rest of the block extends the last one */
+    DIG.run[DIG.count - 1].length++;
+    DIG.overflow = 1;
+  }
+}
+
+static inline void DIG_Reset(void)
+{
+  DIG.count    = 0;
+  DIG.overflow = 0;
+}
+
+/* Called from main(): overflow flag, then state and length of each run */
+static void DIG_Send(const DIG_Block_Runs *runs)
+{
+  uint8_t i;
+
+  USART_Transmit(REC_DIGITAL);
+  REC_Value(runs->overflow, 1);
+  for (i = 0; i < runs->count; i++)
+  {
+    REC_Value(runs->run[i].state,  1);
+    REC_Value(runs->run[i].length, 2);
+  }
+  USART_Transmit('\n');
+}
+
+#if ! ACQ_GATE
+/* Copy of the finished block, owned by main() while DIG_READY */
+static DIG_Block_Runs DIG_OUT;
+static volatile uint8_t DIG_READY = 0;
+
+/* End of block: hand the runs to main() and restart them */
+static inline void DIG_Block(void)
+{
+  if ( ! DIG_READY)
+  {
+    DIG_OUT   = DIG;
+    DIG_READY = 1;
+  }
+  DIG_Reset();
+}
+
+static void DIG_Output(void)
+{
+  if ( ! DIG_READY)
+    return;
+
+  DIG_Send(&DIG_OUT);
+  DIG_READY = 0;
+}
+#endif
+#endif
+#endif
+
+#if ACQ_MODE == ACQ_MODE_GOERTZEL
+static constexpr uint16_t GTZ_FREQ[] = GTZ_FREQS;
+#define GTZ_BINS (sizeof(GTZ_FREQ) / sizeof(GTZ_FREQ[0]))
+
+/* Every bin must keep 2cos(w) inside Q14 and the state inside int16 */
+static constexpr bool GTZ_Valid(uint8_t i)
+{
+  return i >= GTZ_BINS ||
+         (GTZ_FREQ[i] * 50UL >= F_SPL && GTZ_FREQ[i] * 50UL <= F_SPL * 24 &&
+          GTZ_Valid(i + 1));
+}
+static_assert(GTZ_Valid(0), "GTZ_FREQS must lie within 0.02 .. 0.48 * F_SPL");
+
+static int16_t GTZ_COEF[GTZ_BINS];      /* 2cos(w), Q14      */
+static int16_t GTZ_S1[GTZ_BINS];
+static int16_t GTZ_S2[GTZ_BINS];
+static uint8_t GTZ_DROPS = 0;           /* Blocks main() missed */
+/* Copy of the finished block, owned by main() while GTZ_READY */
+static int16_t GTZ_OUT1[GTZ_BINS];
+static int16_t GTZ_OUT2[GTZ_BINS];
+static uint8_t GTZ_OUT_DROPS;
+static volatile uint8_t GTZ_READY = 0;
+
+static void GTZ_Init(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < GTZ_BINS; i++)
+    GTZ_COEF[i] = (int16_t)lround(2.0 * cos(2.0 * M_PI * GTZ_FREQ[i] / F_SPL)
+                                  * (1 << 14));
+}
+
+/*
+    (coef * s) >> 14 for a Q14 coefficient. Two 32-bit left shifts and
+    taking the high word are register moves, where >> 14 is a 14 step
+    shift loop. Valid while the result fits int16, as the state does.
+*/
+static inline int16_t GTZ_Mul(int16_t coef, int16_t s)
+{
+  return (int16_t)(((uint32_t)((int32_t)coef * s) << 2) >> 16);
+}
+
+static inline void GTZ_Sample(uint8_t sample)
+{
+  int16_t x = ((int16_t)sample - 128) >> 1;
+  int16_t s0;
+  uint8_t i;
+
+  for (i = 0; i < GTZ_BINS; i++)
+  {
+    s0 = x + GTZ_Mul(GTZ_COEF[i], GTZ_S1[i]) - GTZ_S2[i];
+    GTZ_S2[i] = GTZ_S1[i];
+    GTZ_S1[i] = s0;
+  }
+}
+
+/* End of block: hand the state to main() and restart the filters */
+static inline void GTZ_Block(void)
+{
+  if ( ! GTZ_READY)
+  {
+    memcpy(GTZ_OUT1, GTZ_S1, sizeof(GTZ_S1));
+    memcpy(GTZ_OUT2, GTZ_S2, sizeof(GTZ_S2));
+    GTZ_OUT_DROPS = GTZ_DROPS;
+    GTZ_DROPS     = 0;
+    GTZ_READY     = 1;
+  }
+  else if (GTZ_DROPS < 0xFF)
+  {
+    /* main() still owns the previous block, this one is lost */
+    GTZ_DROPS++;
+  }
+  memset(GTZ_S1, 0, sizeof(GTZ_S1));
+  memset(GTZ_S2, 0, sizeof(GTZ_S2));
+}
+
+static uint16_t GTZ_Sqrt(uint32_t value)
+{
+  uint32_t root = 0;
+  uint32_t bit  = 1UL << 30;
+
+  while (bit > value)
+    bit >>= 2;
+  while (bit)
+  {
+    if (value >= root + bit)
+    {
+      value -= root + bit;
+      root   = (root >> 1) + bit;
+    }
+    else
+      root >>= 1;
+    bit >>= 2;
+  }
+  return (uint16_t)root;
+}
+
+/* Called from main(), sends the drop count and magnitudes of the last block */
+static void GTZ_Output(void)
+{
+  uint32_t power;
+  int32_t  cross;
+  uint8_t  i;
+
+  if ( ! GTZ_READY)
+    return;
+
+  USART_Transmit(REC_GOERTZEL);
+  REC_Value(GTZ_OUT_DROPS, 2);
+  for (i = 0; i < GTZ_BINS; i++)
+  {
+    /* |X|^2 = s1^2 + s2^2 - 2cos(w) s1 s2, all in 32 bits */
+    power  = (uint32_t)((int32_t)GTZ_OUT1[i] * GTZ_OUT1[i]);
+    power += (uint32_t)((int32_t)GTZ_OUT2[i] * GTZ_OUT2[i]);
+    cross  = (int32_t)GTZ_Mul(GTZ_COEF[i], GTZ_OUT1[i]) * GTZ_OUT2[i];
+    if (cross < 0)
+      power += (uint32_t)(-cross);
+    else if (power > (uint32_t)cross)
+      power -= (uint32_t)cross;
+    else
+      power  = 0;
+    REC_Value(GTZ_Sqrt(power), 3);
+  }
+  USART_Transmit('\n');
+  GTZ_READY = 0;
+}
+#endif
+
+#if ACQ_MODE == ACQ_MODE_STATS
+typedef struct
+{
+  uint8_t  min;
+  uint8_t  max;
+  uint16_t sum;                   /* 128 * 255 fits 16 bits   */
+  uint32_t sum2;                  /* 128 * 255^2 fits 24 bits */
+} STA_Block;
+
+static STA_Block STA = {0xFF, 0x00, 0, 0};
+/* Copy of the finished block, owned by main() while STA_READY */
+static STA_Block STA_OUT;
+static volatile uint8_t STA_READY = 0;
+
+static inline void STA_Sample(uint8_t sample)
+{
+  if (sample < STA.min)
+    STA.min = sample;
+  if (sample > STA.max)
+    STA.max = sample;
+  STA.sum  += sample;
+  STA.sum2 += (uint16_t)sample * sample;
+}
+
+/* End of block: hand the statistics to main() and restart them */
+static inline void STA_Block_End(void)
+{
+  if ( ! STA_READY)
+  {
+    STA_OUT   = STA;
+    STA_READY = 1;
+  }
+  STA.min  = 0xFF;
+  STA.max  = 0x00;
+  STA.sum  = 0;
+  STA.sum2 = 0;
+}
+
+/* Called from main(), mean = sum / 128, RMS = sqrt(sum2 / 128) */
+static void STA_Output(void)
+{
+  if ( ! STA_READY)
+    return;
+
+  USART_Transmit(REC_STATS);
+  REC_Value(STA_OUT.min,  2);
+  REC_Value(STA_OUT.max,  2);
+  REC_Value(STA_OUT.sum,  3);
+  REC_Value(STA_OUT.sum2, 4);
+  USART_Transmit('\n');
+  STA_READY = 0;
+}
+#endif
+
+#if ACQ_GATE
+static uint8_t GATE_BUF[GATE_RING][ADC_SPL_TH];
+#if ACQ_DIGITAL && DIG_PACK == DIG_PACK_RLE
+/* Digital runs of each slot, sent after its samples */
+static DIG_Block_Runs GATE_RUNS[GATE_RING];
+#endif
+static volatile uint8_t GATE_HEAD   = 0;      /* Slot written by the ISR */
+static volatile uint8_t GATE_QUEUED = 0;      /* One bit per slot to send */
+static uint16_t GATE_SUM    = 0;
+static uint32_t GATE_SUM2   = 0;
+static uint8_t  GATE_HANG   = 0;              /* 0 = gate closed         */
+static uint16_t GATE_IDLE   = 0;              /* Blocks suppressed       */
+static uint16_t GATE_TIMER  = 0;              /* Blocks to next keepalive */
+static uint8_t  GATE_FRESH  = 0;              /* Unsent blocks, <= GATE_PREROLL */
+static volatile uint16_t GATE_KEEP = 0;       /* Count to report, 0 none */
+/* Slot the record goes before, GATE_RING = once nothing is queued */
+static volatile uint8_t  GATE_KEEP_SLOT = GATE_RING;
+
+static inline void GATE_Sample(uint8_t sample)
+{
+  GATE_BUF[GATE_HEAD][ADC_SPL_COUNT] = sample;
+  GATE_SUM  += sample;
+  GATE_SUM2 += (uint16_t)sample * sample;
+}
+
+/* End of block: update the gate, queue blocks and pick the next slot */
+static inline void GATE_Block(void)
+{
+  uint8_t head = GATE_HEAD;
+  uint8_t next = (head + 1) & (GATE_RING - 1);
+  uint32_t var;
+  uint8_t  i;
+
+#if ACQ_DIGITAL && DIG_PACK == DIG_PACK_RLE
+  GATE_RUNS[head] = DIG;
+  DIG_Reset();
+#endif
+
+  /* ADC_SPL_TH * variance, the division is a shift */
+  var = GATE_SUM2 - (uint32_t)GATE_SUM * GATE_SUM / ADC_SPL_TH;
+  GATE_SUM  = 0;
+  GATE_SUM2 = 0;
+
+  if (var >= (uint32_t)GATE_ON * ADC_SPL_TH)
+  {
+    /*
+        Opening: queue the pre-roll blocks before this one, only those
+        suppressed since the gate closed, the others were already sent.
+        The host is told how many blocks are missing before them.
+    */
+    if ( ! GATE_HANG)
+    {
+      for (i = 1; i <= GATE_FRESH; i++)
+        GATE_QUEUED |= 1 << ((head - i) & (GATE_RING - 1));
+      if (GATE_IDLE != GATE_FRESH)
+      {
+        GATE_KEEP      = GATE_IDLE - GATE_FRESH;
+        GATE_KEEP_SLOT = (head - GATE_FRESH) & (GATE_RING - 1);
+      }
+    }
+    GATE_HANG = GATE_HANGOVER;
+  }
+  else if (GATE_HANG)
+  {
+    /* Only consecutive quiet blocks close the gate */
+    if (var < (uint32_t)GATE_OFF * ADC_SPL_TH)
+      GATE_HANG--;
+    else
+      GATE_HANG = GATE_HANGOVER;
+  }
+
+  if (GATE_HANG)
+  {
+    GATE_QUEUED |= 1 << head;
+    GATE_IDLE  = 0;
+    GATE_TIMER = 0;
+    GATE_FRESH = 0;
+  }
+  else
+  {
+    if (GATE_FRESH < GATE_PREROLL)
+      GATE_FRESH++;
+    GATE_IDLE++;
+    if (++GATE_TIMER >= GATE_KEEPALIVE)
+    {
+      GATE_TIMER = 0;
+      /* Wraps after ~168s, the host only needs differences */
+      GATE_KEEP      = GATE_IDLE ? GATE_IDLE : 1;
+      GATE_KEEP_SLOT = GATE_RING;
+    }
+  }
+
+  /*
+      main() sends the oldest slot first, so when the next slot is
+      still queued it is busy with it: drop this block and reuse it.
+  */
+  if (GATE_QUEUED & (1 << next))
+    GATE_QUEUED &= ~(1 << head);
+  else
+    GATE_HEAD = next;
+}
+
+/*
+    Called from main(), sends queued blocks oldest first, and the
+    REC_KEEPALIVE record before the slot it was queued for.
+*/
+static void GATE_Output(void)
+{
+  uint8_t  slot, i;
+  uint16_t keep;
+
+  for (;;)
+  {
+    cli();
+    /* The oldest slot is the one after the slot being written */
+    slot = GATE_HEAD;
+    for (i = 0; i < GATE_RING; i++)
+    {
+      slot = (slot + 1) & (GATE_RING - 1);
+      if (GATE_QUEUED & (1 << slot))
+        break;
+    }
+    if (i == GATE_RING)
+      slot = GATE_RING;
+    keep = 0;
+    if (GATE_KEEP && GATE_KEEP_SLOT == slot)
+    {
+      keep      = GATE_KEEP;
+      GATE_KEEP = 0;
+    }
+    sei();
+
+    if (keep)
+    {
+      USART_Transmit(REC_KEEPALIVE);
+      REC_Value(keep, 3);
+      USART_Transmit('\n');
+    }
+    if (slot == GATE_RING)
+      break;
+
+    for (i = 0; i < ADC_SPL_TH; i++)
+      USART_Transmit(GATE_BUF[slot][i]);
+    USART_Transmit('\n');
+#if ACQ_DIGITAL && DIG_PACK == DIG_PACK_RLE
+    DIG_Send(&GATE_RUNS[slot]);
+#endif
+
+    cli();
+    GATE_QUEUED &= ~(1 << slot);
+    sei();
+  }
+}
+#endif
+
+#if ACQ_MODE == ACQ_MODE_DEADBAND
+typedef struct
+{
+  uint8_t  value;
+  uint16_t dt;                    /* Ticks since the previous record */
+} DB_Event;
+
+static DB_Event DB_QUEUE[DB_FIFO];
+static volatile uint8_t DB_HEAD = 0;          /* Written by the ISR */
+static volatile uint8_t DB_TAIL = 0;          /* Written by main()  */
+static uint8_t  DB_LAST = 0;
+static uint16_t DB_DT   = 0;
+
+static inline void DB_Sample(uint8_t sample)
+{
+  uint8_t head = DB_HEAD;
+  uint8_t next = (head + 1) & (DB_FIFO - 1);
+  uint8_t diff = sample > DB_LAST ? sample - DB_LAST : DB_LAST - sample;
+
+  /* Saturate while the queue is full */
+  if (DB_DT < 0xFFFF)
+    DB_DT++;
+  if (diff <= DB_DEADBAND && DB_DT < DB_MAX_DT)
+    return;
+  /* Queue full, keep DB_LAST so a later sample reports the change */
+  if (next == DB_TAIL)
+    return;
+
+  DB_QUEUE[head].value = sample;
+  DB_QUEUE[head].dt    = DB_DT;
+  DB_HEAD = next;
+  DB_LAST = sample;
+  DB_DT   = 0;
+}
+
+/* Called from main(), value and dt are sent as 2 and 3 byte fields */
+static void DB_Output(void)
+{
+  uint8_t tail = DB_TAIL;
+
+  while (tail != DB_HEAD)
+  {
+    USART_Transmit(REC_DEADBAND);
+    REC_Value(DB_QUEUE[tail].value, 2);
+    REC_Value(DB_QUEUE[tail].dt,    3);
+    USART_Transmit('\n');
+    tail    = (tail + 1) & (DB_FIFO - 1);
+    DB_TAIL = tail;
+  }
+}
+#endif
+
+/* Transmit Acquired Sample and close the block every ADC_SPL_TH samples */
+static inline void ACQ_Sample(uint8_t sample)
+{
+#if ACQ_REF_MONITOR
+  if (REF_Slot())
+    return;
+#endif
+#if ACQ_CALIBRATION
+  sample = CAL_Apply(sample);
+#endif
+#if ACQ_BIQUAD
+  if ( ! BIQ_Decimate(&sample))
+    return;
+#endif
+#if ACQ_DIGITAL && DIG_PACK == DIG_PACK_LSB
+  sample = (sample & ~DIG_MASK) | DIG_VALUE;
+#elif ACQ_DIGITAL && DIG_PACK == DIG_PACK_RLE
+  DIG_Sample(DIG_VALUE);
+#endif
+
+#if ACQ_MODE == ACQ_MODE_GOERTZEL
+  GTZ_Sample(sample);
+  if (++ADC_SPL_COUNT >= ADC_SPL_TH)
+  {
+    ADC_SPL_COUNT = 0;
+    GTZ_Block();
+#if ACQ_DIGITAL && DIG_PACK == DIG_PACK_RLE
+    DIG_Block();
+#endif
+  }
+#elif ACQ_MODE == ACQ_MODE_STATS
+  STA_Sample(sample);
+  if (++ADC_SPL_COUNT >= ADC_SPL_TH)
+  {
+    ADC_SPL_COUNT = 0;
+    STA_Block_End();
+#if ACQ_DIGITAL && DIG_PACK == DIG_PACK_RLE
+    DIG_Block();
+#endif
+  }
+#elif ACQ_MODE == ACQ_MODE_DEADBAND
+  DB_Sample(sample);
+#elif ACQ_GATE
+  GATE_Sample(sample);
+  if (++ADC_SPL_COUNT >= ADC_SPL_TH)
+  {
+    ADC_SPL_COUNT = 0;
+    GATE_Block();
+  }
+#else
+  ADC_SPL_COUNT++;
+  /* Transmit Acquired Sample */
+  USART_Transmit(sample);
+#if ACQ_DIGITAL && DIG_PACK == DIG_PACK_BYTE
+  /* The previous tick has left the link, both bytes go out without waiting */
+  USART_Transmit(0x40 | DIG_VALUE);
+#endif
+  if (ADC_SPL_COUNT >= ADC_SPL_TH)
+  {
+    /* Transmit termination character */
+    /*
+        Termination Char will be responsible
+        for LabVIEW or other listening
+        applications organization while
+        listening Serial port. In receiving
+        a termination char the program willknow
+        that a data block has been transmitted.
+
+        Carefull choice of termination char will
+        reduce data loss. Choose a value that
+        wont coincide with ADCH values.
+    */
+    USART_Transmit('\n');
+
+    /* Reset ADC Sample Counter */
+    ADC_SPL_COUNT = 0;
+
+#if ACQ_REF_MONITOR
+    REF_Block();
+#endif
+  }
+#endif
+}
+
+/* Called from main() after every wake up, sends pending records */
+static inline void ACQ_Output(void)
+{
+#if ACQ_MODE == ACQ_MODE_GOERTZEL
+  GTZ_Output();
+#elif ACQ_MODE == ACQ_MODE_STATS
+  STA_Output();
+#elif ACQ_MODE == ACQ_MODE_DEADBAND
+  DB_Output();
+#elif ACQ_GATE
+  GATE_Output();
+#endif
+#if ACQ_DIGITAL && DIG_PACK == DIG_PACK_RLE && ! ACQ_GATE
+  DIG_Output();
+#endif
+}
+
 /* Timer 0 Comparator A Interrupt  */
+#if ACQ_SLEEP == ACQ_SLEEP_ADC
+/* Set by the timer, consumed by main() which runs the conversion */
+volatile uint8_t ACQ_TICK = 0;
+
+ISR(TIMER0_COMPA_vect)
+{
+  SET(PORTB, 4);
+#if ACQ_DIGITAL
+  DIG_Tick();
+#endif
+  ACQ_TICK = 1;
+  CLR(PORTB, 4);
+}
+#elif ACQ_NAKED_ISR && ! ACQ_SAMPLE_WORK
+#if ADC_SPL_TH != 128
+#error "ACQ_NAKED_ISR detects the end of block on bit 7 of ADC_SPL_COUNT"
+#endif
+/*
+    Same behaviour as the C version below. Compiler generated code for
+    it pushes the registers used by USART_Transmit and reloads the
+    volatile counter from SRAM; here only r24 and SREG are saved and
+    the counter stays in GPIOR0.
+*/
+ISR(TIMER0_COMPA_vect, ISR_NAKED)
+{
+  asm volatile(
+    "push r24                  \n\t"
+    "in   r24, __SREG__        \n\t"
+    "push r24                  \n\t"
+    /* Restart ADC Conversion */
+    "lds  r24, %[adcsra]       \n\t"
+    "ori  r24, %[adsc]         \n\t"
+    "sts  %[adcsra], r24       \n\t"
+    /* Set ports HIGH for Osciloscope Tracing */
+    "sbi  %[portb], 4          \n\t"
+    "sbi  %[portb], 5          \n\t"
+    /* Check to see if conversion is complete */
+    "lds  r24, %[adcsra]       \n\t"
+    "sbrc r24, %[adif]         \n\t"
+    "rjmp 3f                   \n\t"
+    /* ADC_SPL_COUNT++ */
+    "in   r24, %[count]        \n\t"
+    "inc  r24                  \n\t"
+    "out  %[count], r24        \n\t"
+    /* Transmit Acquired Sample */
+    "1:                        \n\t"
+    "lds  r24, %[ucsr0a]       \n\t"
+    "sbrs r24, %[udre0]        \n\t"
+    "rjmp 1b                   \n\t"
+    "lds  r24, %[adch]         \n\t"
+    "sts  %[udr0], r24         \n\t"
+    /* ADC_SPL_COUNT >= ADC_SPL_TH */
+    "sbis %[count], 7          \n\t"
+    "rjmp 3f                   \n\t"
+    /* Transmit termination character */
+    "2:                        \n\t"
+    "lds  r24, %[ucsr0a]       \n\t"
+    "sbrs r24, %[udre0]        \n\t"
+    "rjmp 2b                   \n\t"
+    "ldi  r24, %[term]         \n\t"
+    "sts  %[udr0], r24         \n\t"
+    /* Reset ADC Sample Counter */
+    "ldi  r24, 0               \n\t"
+    "out  %[count], r24        \n\t"
+    "3:                        \n\t"
+    "cbi  %[portb], 4          \n\t"
+    "pop  r24                  \n\t"
+    "out  __SREG__, r24        \n\t"
+    "pop  r24                  \n\t"
+    "reti                      \n\t"
+    :
+    : [adcsra] "n" (_SFR_MEM_ADDR(ADCSRA)),
+      [adch]   "n" (_SFR_MEM_ADDR(ADCH)),
+      [ucsr0a] "n" (_SFR_MEM_ADDR(UCSR0A)),
+      [udr0]   "n" (_SFR_MEM_ADDR(UDR0)),
+      [portb]  "I" (_SFR_IO_ADDR(PORTB)),
+      [count]  "I" (_SFR_IO_ADDR(ADC_SPL_COUNT)),
+      [adsc]   "M" (1 << ADSC),
+      [adif]   "I" (ADIF),
+      [udre0]  "I" (UDRE0),
+      [term]   "M" ('\n')
+  );
+}
+#else
 ISR(TIMER0_COMPA_vect)
 {
   /* Restart ADC Conversion */
@@ -61,36 +1294,18 @@ ISR(TIMER0_COMPA_vect)
   */
   SET(PORTB, 4);
   SET(PORTB, 5);
+#if ACQ_DIGITAL
+  DIG_Tick();
+#endif
 
   /* Check to see if conversion is complete */
   if ( ! ( ADCSRA & (1 << ADIF)))
   {
-    ADC_SPL_COUNT++;
-    /* Transmit Acquired Sample */
-    USART_Transmit(ADCH);
-    if (ADC_SPL_COUNT >= ADC_SPL_TH)
-    {
-      /* Transmit termination character */
-      /*
-          Termination Char will be responsible
-          for LabVIEW or other listening
-          applications organization while
-          listening Serial port. In receiving
-          a termination char the program willknow
-          that a data block has been transmitted.
-
-          Carefull choice of termination char will
-          reduce data loss. Choose a value that
-          wont coincide with ADCH values.
-      */
-      USART_Transmit('\n');
-
-      /* Reset ADC Sample Counter */
-      ADC_SPL_COUNT = 0;
-    }
+    ACQ_Sample(ADCH);
   }
   CLR(PORTB, 4);
 }
+#endif
 
 ISR(ADC_vect)
 {
@@ -113,6 +1328,20 @@ int main(void)
   DDRB  = 0x00;
   /* Setup pins 4 & 5 as outputs */
   DDRB  = (1 << DDB4) | (1 << DDB5);
+  /* Reset ADC Sample Counter */
+  ADC_SPL_COUNT = 0;
+#if ACQ_CALIBRATION
+  /* Load Calibration Coefficients */
+  CAL_Load();
+#endif
+#if ACQ_BIQUAD
+  /* Load Default Biquad Coefficients */
+  BIQ_Init();
+#endif
+#if ACQ_MODE == ACQ_MODE_GOERTZEL
+  /* Compute Goertzel Coefficients */
+  GTZ_Init();
+#endif
 
   //* Setup USART Interface *//
   /* Set Baudrate for TX & RX*/                         // (p. 183)
@@ -120,6 +1349,10 @@ int main(void)
   UBRR0L = (BRC     );
   /* Enable Transmitter */
   UCSR0B = (1 << TXEN0);                                // (p. 183)
+#if ACQ_BIQUAD
+  /* Enable Receiver and its interrupt for the command channel */
+  UCSR0B |= (1 << RXEN0) | (1 << RXCIE0);               // (p. 183)
+#endif
   /* Enable double speed USART operation */
   UCSR0A |= (1 << U2X0);
   /* Set up frame size for TX & RX to 8-bit */
@@ -139,15 +1372,20 @@ int main(void)
       F_TIMER0 = F_CPU / (Prescaler*(OCR0A+1))
   */
   /* Setup Timer 0 Prescaler */
-  TCCR0B |= (0 << CS02) | (1 << CS01) | (0 << CS00);
+  TCCR0B |= SPL_CS;
   /* Setup Output Compare Value */
   /*
-     Getting 48.804kHz from this sketch, hence F_CPU must be 15.617280 MHz
-     a 382.720 kHz deviation from the specification. Therefore it is
-     generally speaking a good ideia to calibrate and compensate via OCR0A
-     the clock deviation.
+     Nominal rate is F_SPL = 50kHz. Getting 48.804kHz from this sketch,
+     hence F_CPU must be 15.617280 MHz a 382.720 kHz deviation from the
+     specification. Therefore it is generally speaking a good ideia to
+     calibrate and compensate via SPL_OCR the clock deviation, and to
+     tell host tools the measured rate rather than 44.1kHz.
   */
-  OCR0A   = 39; // yields aproximatly 50kHz for my cristal
+#if ACQ_SLEEP == ACQ_SLEEP_ADC
+  OCR0A   = SPL_OCR_ADC_SLEEP;
+#else
+  OCR0A   = SPL_OCR;
+#endif
   /* Setup interrupt Mask */
   TIMSK0 |= (1 << OCIE0A);
 
@@ -159,7 +1397,7 @@ int main(void)
   ADCSRB = 0x00;
   ADMUX  = 0x00;
   /* Set Analog pin */
-  ADMUX |= (ADC0 & MUXMASK);                            // (p. 262)
+  ADMUX |= (ADC_CHANNEL & MUXMASK);                     // (p. 262)
   /* Set Reference Voltage */
   ADMUX |= (1 << REFS0);                                // (p. 262)
   /* Set ADC value alignment */
@@ -169,8 +1407,11 @@ int main(void)
   ADCSRA |= (1 << ADPS2) | (0 << ADPS1) | (0 << ADPS0); // (p. 264, 255)
   /* Set up ADC Auto Trigger Source to Timer 0 Comparator A */
   ADCSRB |= (0 << ADTS2) | (1 << ADTS1) | (1 << ADTS0); // (p. 265, 266, 253)
+#if ACQ_SLEEP != ACQ_SLEEP_ADC
   /* Enable ADC Auto Trigger Mode */
+  /* (in ACQ_SLEEP_ADC entering sleep starts the conversion) */
   ADCSRA |= (1 << ADATE);                               // (p. 264)
+#endif
   /* Enable ADC Interrrupt when measurement is completed */
   ADCSRA |= (1 << ADIE);                                // (p. 264)
   /* Enable ADC */
@@ -183,9 +1424,42 @@ int main(void)
   /* Disable Global Interrupts */
   SREG |= (1 << 7);
 
+  //* Setup Sleep Mode *//
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+
   while (1)
   {
+#if ACQ_SLEEP == ACQ_SLEEP_ADC
+    /* Wait for the next timer tick without missing it */
+    cli();
+    if ( ! ACQ_TICK)
+    {
+      /* sei() delays interrupts by one instruction, so we reach sleep */
+      sei();
+      sleep_cpu();
+      continue;
+    }
+    ACQ_TICK = 0;
+    sei();
+
+    /* Convert with CPU and I/O clocks stopped, ADC_vect wakes us up */
+    set_sleep_mode(SLEEP_MODE_ADC);
+    SET(PORTB, 5);
+    do
+    {
+      sleep_cpu();
+    } while (ADCSRA & (1 << ADSC));
+    set_sleep_mode(SLEEP_MODE_IDLE);
 
+    ACQ_Sample(ADCH);
+    /* USART stops in ADC Noise Reduction, finish the frame before */
+    USART_Flush();
+#else
+    /* Nothing to do until the next timer tick */
+    sleep_cpu();
+    ACQ_Output();
+#endif
   }
   return 0;
 }